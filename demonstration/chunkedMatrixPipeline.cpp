@@ -0,0 +1,404 @@
+/* OUT-OF-CORE PROCESSING:
+ * =======================
+ * The Matrix class that was introduced in objectOrientation.cpp stores ALL
+ * of its elements in memory at once. For very large datasets this is not
+ * possible - the data simply DO NOT FIT in the available RAM. Instead, the
+ * data must be kept in a FILE and processed in CHUNKS that are read, operated
+ * upon and written back one at a time. This is known as OUT-OF-CORE
+ * processing.
+ *
+ * A NAIVE implementation SERIALIZES the three steps:
+ *
+ *   read chunk 0 -> compute chunk 0 -> write chunk 0 -> read chunk 1 -> ...
+ *
+ * While a chunk is being read or written the CPU is idle, and while a chunk
+ * is being computed the disk is idle.
+ *
+ * A better approach OVERLAPS input/output (I/O) with computation. While
+ * chunk N is being computed, chunk N+1 is already being read (PREFETCHING)
+ * and chunk N-1 is being written back. Each of these three chunks needs
+ * its own buffer, so the buffers are used in ROTATION. This is an
+ * extension of the common DOUBLE BUFFERING technique, in which one buffer
+ * is filled while the other is computed.
+ *
+ * NOTE: Operating systems provide specialized asynchronous I/O interfaces
+ * (e.g. io_uring on Linux). Here we use only the PORTABLE facilities of the
+ * C++ standard library: the std::async function runs a task on another
+ * thread and returns a std::future that can be used to wait for the result.
+ */
+
+// include the string header file to provide the std::string type
+#include <string>
+// include the iostream header to enable terminal output
+#include <iostream>
+// include the fstream header to enable file input and output
+#include <fstream>
+// include the vector header to provide the resizable std::vector container
+#include <vector>
+// include the functional header to provide the std::function type
+#include <functional>
+// include the future header to provide std::async and std::future
+#include <future>
+// include the stdexcept header to provide std::runtime_error
+#include <stdexcept>
+// include the cstdio header to provide std::remove
+#include <cstdio>
+// include the cstddef header to provide the std::size_t type
+#include <cstddef>
+
+/* A cut-down version of the Matrix class from objectOrientation.cpp with
+ * two additional methods that report its shape and one that writes its
+ * elements to a binary file.
+ *
+ * NOTE: The elements are stored with the OUTERMOST (i.e. first) dimension
+ * varying SLOWEST. A contiguous range of indices along the outermost
+ * dimension therefore corresponds to a CONTIGUOUS range of elements in
+ * memory and in the file. We will call each such index a SLICE.
+ */
+class Matrix {
+
+  // The number of Matrix dimensions components
+  unsigned int dimensions;
+
+  // Dynamically allocated array of Matrix elements
+  double * elements;
+
+  /* Dynamically allocated array of comprising dimensions
+   * elements, each of which specifies the size of the
+   * corresponding dimension.
+   */
+  unsigned int * dimensionality;
+
+public :
+
+  // PARAMETERIZED constructor - see objectOrientation.cpp
+  Matrix(unsigned int dimensionsArg,
+	 double elementsArg[],
+	 unsigned int dimensionalityArg[]
+	 );
+
+  // DESTRUCTOR frees memory allocated by the constructor.
+  ~Matrix(){
+    delete[] dimensionality;
+    delete[] elements;
+  }
+
+  // Returns the size of the outermost dimension i.e. the number of slices.
+  unsigned int getNumSlices(){
+    return dimensionality[0];
+  }
+
+  /* Returns the number of elements in each slice.
+   * NOTE: std::size_t is an unsigned type that is large enough to count
+   * the elements of ANY array. An unsigned int may be only 32 bits wide,
+   * which limits it to about 4 billion.
+   */
+  std::size_t getSliceSize();
+
+  // Writes all elements to the named file as raw binary data.
+  void writeElements(std::string fileName);
+
+};
+
+// Out of class definition of the constructor for the Matrix class.
+Matrix::Matrix(unsigned int dimensionsArg,
+	       double elementsArg[],
+	       unsigned int dimensionalityArg[]
+	       ):
+  dimensions(dimensionsArg)
+{
+  std::size_t numElements(1);
+  dimensionality = new unsigned int[dimensions];
+  for (unsigned int dimension = 0; dimension < dimensions; ++dimension){
+    dimensionality[dimension] = dimensionalityArg[dimension];
+    numElements *= dimensionality[dimension];
+  }
+  elements = new double[numElements];
+  for(std::size_t element = 0; element < numElements; ++element){
+    elements[element] = elementsArg[element];
+  }
+}
+
+// The slice size is the product of all dimension sizes EXCEPT the first.
+std::size_t Matrix::getSliceSize(){
+  std::size_t sliceSize(1);
+  for (unsigned int dimension = 1; dimension < dimensions; ++dimension){
+    sliceSize *= dimensionality[dimension];
+  }
+  return sliceSize;
+}
+
+void Matrix::writeElements(std::string fileName){
+  std::ofstream output(fileName, std::ios::binary);
+  /* The write method expects a pointer to char. The reinterpret_cast
+   * operator tells the compiler to treat the address of the first
+   * element as the address of the first BYTE.
+   *
+   * NOTE: getNumSlices() is CONVERTED to std::size_t BEFORE multiplying so
+   * that the product is not computed in 32 bits.
+   */
+  std::size_t numElements = std::size_t(getNumSlices()) * getSliceSize();
+  output.write(reinterpret_cast<const char *>(elements),
+	       std::streamsize(numElements * sizeof(double)));
+}
+
+/* THE PIPELINE:
+ * =============
+ * ChunkedMatrixPipeline streams the elements of a Matrix that has been
+ * written to a file through two USER-DEFINED stages:
+ *
+ * - A MAP stage that modifies the elements of each chunk IN PLACE. The
+ * modified chunk is then written to an output file.
+ * - A REDUCE stage that combines the elements of each chunk into a single
+ * running result, e.g. a sum.
+ *
+ * Both stages are supplied as std::function objects. A std::function can
+ * hold ANY callable entity with a matching signature - an ordinary function,
+ * or a LAMBDA EXPRESSION (see main below).
+ */
+class ChunkedMatrixPipeline {
+
+  // The file from which the Matrix elements are read.
+  std::string inputFileName;
+  // The file to which the mapped Matrix elements are written.
+  std::string outputFileName;
+  // The number of slices along the outermost dimension.
+  unsigned int numSlices;
+  // The number of elements in each slice.
+  std::size_t sliceSize;
+  // The number of slices that are read at once.
+  unsigned int slicesPerChunk;
+
+  /* Reads the chunk with index chunkIndex into buffer. These are
+   * PRIVATE helper methods that are run asynchronously by run().
+   */
+  void readChunk(std::ifstream & input, std::vector<double> & buffer,
+		 unsigned int chunkIndex);
+  // Writes the contents of buffer to output.
+  void writeChunk(std::ofstream & output, const std::vector<double> & buffer);
+
+public :
+
+  ChunkedMatrixPipeline(std::string inputFileNameArg,
+			std::string outputFileNameArg,
+			unsigned int numSlicesArg,
+			std::size_t sliceSizeArg,
+			unsigned int slicesPerChunkArg);
+
+  /* Streams every chunk through mapStage and reduceStage and returns the
+   * final reduced value. The reduction starts from initialValue.
+   */
+  double run(std::function<void(std::vector<double> &)> mapStage,
+	     std::function<double(double, const std::vector<double> &)> reduceStage,
+	     double initialValue);
+
+};
+
+/* The constructor REJECTS a chunk size of zero - no progress could ever be
+ * made - by throwing an exception.
+ */
+ChunkedMatrixPipeline::ChunkedMatrixPipeline(std::string inputFileNameArg,
+					     std::string outputFileNameArg,
+					     unsigned int numSlicesArg,
+					     std::size_t sliceSizeArg,
+					     unsigned int slicesPerChunkArg):
+  inputFileName(inputFileNameArg),
+  outputFileName(outputFileNameArg),
+  numSlices(numSlicesArg),
+  sliceSize(sliceSizeArg),
+  slicesPerChunk(slicesPerChunkArg)
+{
+  if(slicesPerChunk == 0){
+    throw std::invalid_argument("slicesPerChunk must be greater than zero");
+  }
+}
+
+void ChunkedMatrixPipeline::readChunk(std::ifstream & input,
+				      std::vector<double> & buffer,
+				      unsigned int chunkIndex){
+  // The final chunk may contain fewer than slicesPerChunk slices.
+  unsigned int firstSlice = chunkIndex * slicesPerChunk;
+  unsigned int chunkSlices = slicesPerChunk;
+  if(chunkSlices > numSlices - firstSlice){
+    chunkSlices = numSlices - firstSlice;
+  }
+  buffer.resize(std::size_t(chunkSlices) * sliceSize);
+  input.read(reinterpret_cast<char *>(buffer.data()),
+	     std::streamsize(buffer.size() * sizeof(double)));
+  /* An exception thrown here is STORED in the std::future and re-thrown
+   * when the owning thread calls get().
+   */
+  if(!input){
+    throw std::runtime_error("Failed to read chunk from " + inputFileName);
+  }
+}
+
+void ChunkedMatrixPipeline::writeChunk(std::ofstream & output,
+				       const std::vector<double> & buffer){
+  output.write(reinterpret_cast<const char *>(buffer.data()),
+	       std::streamsize(buffer.size() * sizeof(double)));
+  if(!output){
+    throw std::runtime_error("Failed to write chunk to " + outputFileName);
+  }
+}
+
+double ChunkedMatrixPipeline::run(std::function<void(std::vector<double> &)> mapStage,
+				  std::function<double(double, const std::vector<double> &)> reduceStage,
+				  double initialValue){
+  double result(initialValue);
+  // Round UP so that a partial final chunk is included.
+  unsigned int numChunks = numSlices / slicesPerChunk;
+  if(numSlices % slicesPerChunk != 0){
+    numChunks++;
+  }
+  if(numChunks == 0){
+    return result;
+  }
+
+  std::ifstream input(inputFileName, std::ios::binary);
+  if(!input){
+    throw std::runtime_error("Failed to open " + inputFileName);
+  }
+  std::ofstream output(outputFileName, std::ios::binary);
+  if(!output){
+    throw std::runtime_error("Failed to open " + outputFileName);
+  }
+
+  /* The THREE buffers used in rotation. While chunk N is computed in
+   * buffers[N % 3], chunk N+1 is read into buffers[(N + 1) % 3] and
+   * chunk N-1 is written from buffers[(N - 1) % 3].
+   */
+  std::vector<double> buffers[3];
+
+  /* Futures for the single read and single write that may be in flight.
+   * Only ONE read and ONE write are ever pending, so the streams are never
+   * accessed by two threads at the same time.
+   *
+   * NOTE: The futures are declared AFTER the buffers, so if an exception
+   * is thrown they are destroyed FIRST. The destructor of a std::future
+   * returned by std::async waits for its task to finish, so no task can
+   * outlive the buffer it uses.
+   */
+  std::future<void> pendingRead;
+  std::future<void> pendingWrite;
+
+  // PREFETCH the first chunk.
+  pendingRead = std::async(std::launch::async,
+			   &ChunkedMatrixPipeline::readChunk, this,
+			   std::ref(input), std::ref(buffers[0]), 0u);
+
+  for(unsigned int chunk = 0; chunk < numChunks; ++chunk){
+    // The buffers rotate roles on every iteration.
+    std::vector<double> & currentBuffer = buffers[chunk % 3];
+    std::vector<double> & nextBuffer = buffers[(chunk + 1) % 3];
+
+    // Wait for the current chunk to finish loading.
+    pendingRead.get();
+
+    /* Start loading the next chunk BEFORE computing the current one.
+     * nextBuffer last held chunk N-2, whose write was completed before
+     * the write of chunk N-1 was started, so it is free to be reused.
+     */
+    if(chunk + 1 < numChunks){
+      pendingRead = std::async(std::launch::async,
+			       &ChunkedMatrixPipeline::readChunk, this,
+			       std::ref(input), std::ref(nextBuffer), chunk + 1);
+    }
+
+    // Compute while the next chunk loads and the previous one is written.
+    mapStage(currentBuffer);
+    result = reduceStage(result, currentBuffer);
+
+    /* The output stream may only be used by one write at a time, so wait
+     * for the write of the previous chunk (usually already finished)...
+     */
+    if(pendingWrite.valid()){
+      pendingWrite.get();
+    }
+
+    /* ...then write the current chunk back while the next one is computed.
+     * std::cref passes a CONST reference, so the compiler guarantees that
+     * the write task cannot modify the buffer.
+     */
+    pendingWrite = std::async(std::launch::async,
+			      &ChunkedMatrixPipeline::writeChunk, this,
+			      std::ref(output), std::cref(currentBuffer));
+  }
+
+  // Wait for the final write before the output stream is closed.
+  pendingWrite.get();
+
+  return result;
+}
+
+#ifndef __CLING__
+int main (){
+#endif
+
+  // Instantiate a small 5x3 Matrix. Real datasets would be far larger!
+  unsigned int dimensionSizes[2] = { 5, 3 };
+  double matrixValues[15] = { 1, 2, 3,
+			      4, 5, 6,
+			      7, 8, 9,
+			      10, 11, 12,
+			      13, 14, 15 };
+  Matrix matrixInstance(2, matrixValues, dimensionSizes);
+
+  // Write the elements to a file so that they can be streamed back.
+  matrixInstance.writeElements("matrixInput.bin");
+
+  /* Stream the Matrix in chunks of 2 slices (6 elements). The final chunk
+   * contains only a single slice.
+   */
+  ChunkedMatrixPipeline pipeline("matrixInput.bin",
+				 "matrixOutput.bin",
+				 matrixInstance.getNumSlices(),
+				 matrixInstance.getSliceSize(),
+				 2);
+
+  /* LAMBDA EXPRESSIONS define unnamed functions inline. The square
+   * brackets introduce the lambda, followed by a parameter list and body.
+   */
+  double sumOfSquares = pipeline.run(
+    // MAP stage: square every element in place.
+    [](std::vector<double> & chunk){
+      for(std::size_t element = 0; element < chunk.size(); ++element){
+	chunk[element] *= chunk[element];
+      }
+    },
+    // REDUCE stage: accumulate the sum of the (squared) elements.
+    [](double runningTotal, const std::vector<double> & chunk){
+      for(std::size_t element = 0; element < chunk.size(); ++element){
+	runningTotal += chunk[element];
+      }
+      return runningTotal;
+    },
+    0.0);
+
+  // The sum of the squares of 1..15 is 1240.
+  std::cout << "Sum of squares: " << sumOfSquares << std::endl;
+
+  /* Read the output file back to CHECK that the asynchronous writes stored
+   * every squared element in the correct order.
+   */
+  double outputValues[15];
+  std::ifstream outputCheck("matrixOutput.bin", std::ios::binary);
+  outputCheck.read(reinterpret_cast<char *>(outputValues), sizeof(outputValues));
+  bool outputMatches(outputCheck.gcount() == sizeof(outputValues));
+  for(int element = 0; outputMatches && element < 15; ++element){
+    outputMatches = (outputValues[element]
+		     == matrixValues[element] * matrixValues[element]);
+  }
+  outputCheck.close();
+  std::cout << "Output file "
+	    << (outputMatches ? "matches" : "DOES NOT match")
+	    << " the squared elements." << std::endl;
+
+  // Tidy up the temporary files.
+  std::remove("matrixInput.bin");
+  std::remove("matrixOutput.bin");
+
+#ifndef __CLING__
+  return 0;
+}
+#endif
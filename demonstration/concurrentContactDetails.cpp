@@ -0,0 +1,603 @@
+/* SHARING OBJECTS BETWEEN THREADS:
+ * ================================
+ * The ContactDetailsHandler class that was introduced in
+ * objectOrientation.cpp is NOT THREAD SAFE. If one thread calls setAddress
+ * while another calls getAddress, the reader may observe the NEW value of
+ * numAddressLines together with the OLD contents of addressLines (or vice
+ * versa). This is called a TORN READ, and formally it is UNDEFINED
+ * BEHAVIOUR (a DATA RACE).
+ *
+ * The simplest fix is to guard every method with a single MUTEX. However,
+ * a mutex allows only ONE thread at a time to read, so when MANY threads
+ * read and FEW threads write, the readers spend most of their time waiting
+ * for each other.
+ *
+ * A better approach for READ-MOSTLY data is SNAPSHOT PUBLICATION (the idea
+ * behind READ-COPY-UPDATE, or RCU):
+ *
+ * - All of the contact's data are stored together in an IMMUTABLE
+ * SNAPSHOT object. Once published, a snapshot is NEVER modified.
+ * - Readers atomically load a POINTER to the CURRENT snapshot and read from
+ * it without taking any lock. Because the snapshot never changes, every
+ * field that they read is mutually CONSISTENT.
+ * - Writers COPY the current snapshot, UPDATE the copy and then atomically
+ * PUBLISH it by replacing the pointer.
+ *
+ * The remaining difficulty is knowing when an OLD snapshot can be deleted -
+ * a reader might still be using it! Here we use EPOCH-BASED RECLAMATION:
+ *
+ * - A shared counter, the GLOBAL EPOCH, is incremented every time a new
+ * snapshot is published. The replaced snapshot is RETIRED and tagged with
+ * the new epoch value.
+ * - Each reader thread owns a SLOT. Before loading the snapshot pointer,
+ * the reader records the current global epoch in its slot. When it has
+ * finished, it resets its slot to 0 ("not reading").
+ * - A reader whose slot holds an epoch AT LEAST AS LARGE as a retired
+ * snapshot's tag started reading AFTER that snapshot was replaced, so it
+ * cannot be using it. Once EVERY active reader satisfies this, the retired
+ * snapshot is deleted.
+ *
+ * The epoch, the reader slots and the retired snapshots belong to a single
+ * EPOCH DOMAIN that is SHARED by every contact. A program holding millions
+ * of contacts therefore needs only one slot per reader THREAD, not one per
+ * contact. A thread's slot is returned to the domain when the thread exits,
+ * so threads may come and go freely.
+ *
+ * Readers are WAIT-FREE: once a thread has its slot, each read performs a
+ * fixed number of atomic loads and stores, never loops and never waits for
+ * another thread. Each reader only WRITES to its own slot, so readers do
+ * not slow each other down.
+ */
+
+// include the string header file to provide the std::string type
+#include <string>
+// include the iostream header to enable terminal output
+#include <iostream>
+// include the atomic header to provide std::atomic
+#include <atomic>
+// include the mutex header to provide std::mutex and std::lock_guard
+#include <mutex>
+// include the thread header to provide std::thread
+#include <thread>
+// include the vector header to provide the resizable std::vector container
+#include <vector>
+// include the utility header to provide std::pair
+#include <utility>
+// include the cstdint header to provide the std::uint64_t type
+#include <cstdint>
+// include the cstddef header to provide the std::size_t type
+#include <cstddef>
+// include the chrono header to provide clocks for timing
+#include <chrono>
+
+/* An IMMUTABLE snapshot of the contact's private data. A struct is simply
+ * a class whose members have PUBLIC access by default.
+ */
+struct ContactSnapshot {
+  // The contact's phone number
+  int phoneNumber;
+  // The contact's address
+  std::string addressLines[5];
+  // The number of lines in the contact's address
+  int numAddressLines;
+};
+
+// Concatenates the address lines of a snapshot into a single string.
+std::string getAddressAsString(const ContactSnapshot & snapshot){
+  std::string addressAsString = "";
+  int addressLine(0);
+  while(addressLine < snapshot.numAddressLines - 1){
+    addressAsString += (snapshot.addressLines[addressLine] + ", ");
+    addressLine++;
+  }
+  // append the final line without a comma.
+  if(snapshot.numAddressLines > 0){
+    addressAsString += snapshot.addressLines[addressLine];
+  }
+  return addressAsString;
+}
+
+/* Copies numAddressLinesArg lines into snapshot. The number of lines is
+ * CLAMPED to the range 0 to 5 so that getAddressAsString can never read
+ * past the end of the addressLines array.
+ */
+void copyAddress(ContactSnapshot & snapshot,
+		 std::string * addressLinesArg, int numAddressLinesArg){
+  if(numAddressLinesArg < 0){
+    numAddressLinesArg = 0;
+  }
+  if(numAddressLinesArg > 5){
+    numAddressLinesArg = 5;
+  }
+  snapshot.numAddressLines = numAddressLinesArg;
+  for(int addressLine = 0; addressLine < 5; ++addressLine){
+    snapshot.addressLines[addressLine] =
+      addressLine < numAddressLinesArg ? addressLinesArg[addressLine] : "";
+  }
+}
+
+/* Definition of MutexContactDetailsHandler - the SIMPLE fix. Every method
+ * locks the same mutex, so only one thread can read at a time. It is used
+ * below as a BASELINE for comparison.
+ */
+class MutexContactDetailsHandler {
+
+public:
+
+  MutexContactDetailsHandler():
+    snapshot{0, {}, 0}
+  {}
+
+  int getPhoneNumber(){
+    // The lock_guard releases the mutex automatically when it goes out of scope.
+    std::lock_guard<std::mutex> lock(handlerMutex);
+    return snapshot.phoneNumber;
+  }
+
+  void setPhoneNumber(int phoneNumberArg){
+    std::lock_guard<std::mutex> lock(handlerMutex);
+    snapshot.phoneNumber = phoneNumberArg;
+  }
+
+  std::string getAddress(){
+    std::lock_guard<std::mutex> lock(handlerMutex);
+    return getAddressAsString(snapshot);
+  }
+
+  void setAddress(std::string * addressLinesArg, int numAddressLinesArg){
+    std::lock_guard<std::mutex> lock(handlerMutex);
+    copyAddress(snapshot, addressLinesArg, numAddressLinesArg);
+  }
+
+private:
+
+  // Guards ALL access to snapshot.
+  std::mutex handlerMutex;
+  // The contact's data. Unlike below, this IS modified in place.
+  ContactSnapshot snapshot;
+
+};
+
+/* Definition of EpochDomain - the epoch-based reclamation machinery that
+ * is shared by every ConcurrentContactDetailsHandler. There is exactly ONE
+ * instance, which is obtained by calling getInstance().
+ */
+class EpochDomain {
+
+public:
+
+  // Returns the single, shared EpochDomain.
+  static EpochDomain & getInstance(){
+    /* A static local variable is initialized the FIRST time this line is
+     * executed (safely, even if several threads get here at once) and
+     * destroyed when the program ends.
+     */
+    static EpochDomain instance;
+    return instance;
+  }
+
+  /* A reader's slot. If the epochs of two slots shared the same 64-byte
+   * CACHE LINE, every store by one reader would force the other CPU cores
+   * to reload it (this is called FALSE SHARING). Each slot is therefore
+   * PADDED to 128 bytes, so the epochs of two separately allocated slots
+   * are always at least 128 bytes - two cache lines - apart.
+   */
+  struct ReaderSlot {
+    /* The epoch at which the reader started reading, or 0 if not reading.
+     * std::uint64_t is EXACTLY 64 bits wide on every platform, so the
+     * epoch will never, in practice, wrap around to 0. An unsigned long is
+     * only 32 bits wide on some platforms.
+     */
+    std::atomic<std::uint64_t> epoch;
+    // Whether a thread currently owns this slot. Guarded by slotMutex.
+    bool inUse;
+    // The next slot in the list. Never changes once the slot is published.
+    ReaderSlot * next;
+    // Unused bytes that make up the padding.
+    char padding[128 - sizeof(std::atomic<std::uint64_t>) - sizeof(bool)
+		 - sizeof(ReaderSlot *)];
+  };
+
+  /* Marks the calling thread as READING for as long as the guard exists,
+   * in the same way that a std::lock_guard holds a mutex for as long as it
+   * exists. Because the destructor ALWAYS runs - even if an exception is
+   * thrown - a reader can never be left marked as reading.
+   *
+   * NOTE: The contact's snapshot pointer must be loaded AFTER the guard
+   * has been constructed.
+   */
+  class ReadGuard {
+  public:
+    ReadGuard():
+      slot(EpochDomain::getInstance().getReaderSlot())
+    {
+      slot.epoch.store(EpochDomain::getInstance().globalEpoch.load());
+    }
+    ~ReadGuard(){
+      slot.epoch.store(0);
+    }
+    // A guard may not be copied. "= delete" removes the copy constructor.
+    ReadGuard(const ReadGuard &) = delete;
+    ReadGuard & operator=(const ReadGuard &) = delete;
+  private:
+    ReaderSlot & slot;
+  };
+
+  /* Retires oldSnapshot, which has JUST been replaced, and deletes any
+   * retired snapshots that no reader can still be using.
+   */
+  void retire(const ContactSnapshot * oldSnapshot);
+
+  /* The DESTRUCTOR deletes the reader slots and any remaining retired
+   * snapshots. It runs when the program ends.
+   */
+  ~EpochDomain();
+
+private:
+
+  // The constructor is PRIVATE so that only getInstance() can call it.
+  EpochDomain():
+    globalEpoch(1),
+    firstSlot(nullptr)
+  {}
+
+  /* NOTE: All of the atomic operations use the default, STRONGEST memory
+   * ordering (sequentially consistent), which the argument for the
+   * correctness of epoch-based reclamation relies upon.
+   */
+
+  // Incremented every time any contact publishes a new snapshot.
+  std::atomic<std::uint64_t> globalEpoch;
+
+  /* The head of a LINKED LIST of every slot ever created. Slots are reused
+   * when threads exit, so the list only grows to the largest number of
+   * threads that have been reading AT THE SAME TIME.
+   */
+  std::atomic<ReaderSlot *> firstSlot;
+
+  // Guards the inUse flags and the addition of new slots.
+  std::mutex slotMutex;
+
+  /* Snapshots that have been replaced but may still be in use, each paired
+   * with the epoch at which it was retired.
+   */
+  std::vector<std::pair<const ContactSnapshot *, std::uint64_t> > retiredSnapshots;
+
+  // Guards retiredSnapshots.
+  std::mutex retiredMutex;
+
+  /* Acquires a slot when a thread first reads and releases it again when
+   * the thread exits.
+   */
+  class ReaderRegistration {
+  public:
+    ReaderRegistration():
+      slot(EpochDomain::getInstance().acquireSlot())
+    {}
+    ~ReaderRegistration(){
+      EpochDomain::getInstance().releaseSlot(*slot);
+    }
+    ReaderSlot * slot;
+  };
+
+  // Returns the calling thread's slot, acquiring one if necessary.
+  ReaderSlot & getReaderSlot(){
+    /* A thread_local variable has a SEPARATE copy in every thread. It is
+     * initialized the FIRST time each thread executes this line and
+     * destroyed when that thread exits.
+     */
+    static thread_local ReaderRegistration registration;
+    return *registration.slot;
+  }
+
+  // Reuses a free slot or adds a new one to the list.
+  ReaderSlot * acquireSlot();
+
+  // Returns slot to the list of free slots.
+  void releaseSlot(ReaderSlot & slot);
+
+};
+
+EpochDomain::ReaderSlot * EpochDomain::acquireSlot(){
+  std::lock_guard<std::mutex> lock(slotMutex);
+  for(ReaderSlot * slot = firstSlot.load(); slot != nullptr; slot = slot->next){
+    if(!slot->inUse){
+      slot->inUse = true;
+      return slot;
+    }
+  }
+  /* No free slot exists. Fully initialize a new one BEFORE publishing it
+   * at the head of the list, where writers may immediately see it.
+   */
+  ReaderSlot * slot = new ReaderSlot;
+  slot->epoch = 0;
+  slot->inUse = true;
+  slot->next = firstSlot.load();
+  firstSlot.store(slot);
+  return slot;
+}
+
+void EpochDomain::releaseSlot(ReaderSlot & slot){
+  std::lock_guard<std::mutex> lock(slotMutex);
+  slot.epoch.store(0);
+  slot.inUse = false;
+}
+
+void EpochDomain::retire(const ContactSnapshot * oldSnapshot){
+  /* The caller has ALREADY published the new snapshot, so any reader that
+   * records an epoch of retireEpoch or later is guaranteed to load the new
+   * snapshot (or a later one).
+   */
+  std::uint64_t retireEpoch = ++globalEpoch;
+
+  std::lock_guard<std::mutex> lock(retiredMutex);
+  retiredSnapshots.push_back(std::make_pair(oldSnapshot, retireEpoch));
+
+  // Find the OLDEST epoch recorded by any active reader.
+  std::uint64_t oldestActiveEpoch = retireEpoch;
+  for(ReaderSlot * slot = firstSlot.load(); slot != nullptr; slot = slot->next){
+    std::uint64_t slotEpoch = slot->epoch.load();
+    if(slotEpoch != 0 && slotEpoch < oldestActiveEpoch){
+      oldestActiveEpoch = slotEpoch;
+    }
+  }
+
+  /* Delete retired snapshots that every active reader started reading
+   * after, and keep the rest for a later attempt.
+   */
+  std::size_t numKept(0);
+  for(std::size_t retired = 0; retired < retiredSnapshots.size(); ++retired){
+    if(retiredSnapshots[retired].second <= oldestActiveEpoch){
+      delete retiredSnapshots[retired].first;
+    } else {
+      retiredSnapshots[numKept++] = retiredSnapshots[retired];
+    }
+  }
+  retiredSnapshots.resize(numKept);
+}
+
+EpochDomain::~EpochDomain(){
+  for(std::size_t retired = 0; retired < retiredSnapshots.size(); ++retired){
+    delete retiredSnapshots[retired].first;
+  }
+  ReaderSlot * slot = firstSlot.load();
+  while(slot != nullptr){
+    ReaderSlot * next = slot->next;
+    delete slot;
+    slot = next;
+  }
+}
+
+/* Definition of ConcurrentContactDetailsHandler - provides the same
+ * getter and setter methods as ContactDetailsHandler, but these may be
+ * called SAFELY from many threads at once. Reads never take a lock.
+ *
+ * NOTE: Apart from its snapshot, each contact stores only a pointer and a
+ * mutex. The reader slots live in the shared EpochDomain.
+ */
+class ConcurrentContactDetailsHandler {
+
+public:
+
+  // The constructor publishes an initial, empty snapshot.
+  ConcurrentContactDetailsHandler():
+    currentSnapshot(new ContactSnapshot{0, {}, 0})
+  {}
+
+  /* The DESTRUCTOR deletes the current snapshot. Replaced snapshots are
+   * owned by the EpochDomain.
+   * NOTE: No other thread may be using the handler when it is destroyed.
+   */
+  ~ConcurrentContactDetailsHandler(){
+    delete currentSnapshot.load();
+  }
+
+  // Wait-free "GETTER" method to retrieve the contact's phone number
+  int getPhoneNumber(){
+    EpochDomain::ReadGuard guard;
+    return currentSnapshot.load()->phoneNumber;
+  }
+
+  // "SETTER" method to set the contact's phone number
+  void setPhoneNumber(int phoneNumberArg);
+
+  // Wait-free method that returns the contact's address.
+  std::string getAddress(){
+    /* Load the snapshot ONCE. Reading addressLines and numAddressLines
+     * from the same snapshot guarantees that they are consistent.
+     */
+    EpochDomain::ReadGuard guard;
+    return getAddressAsString(*currentSnapshot.load());
+  }
+
+  // This method sets the lines of the contact's address.
+  void setAddress(std::string * addressLinesArg, int numAddressLinesArg);
+
+private:
+
+  // The currently published snapshot.
+  std::atomic<const ContactSnapshot *> currentSnapshot;
+
+  /* Serializes WRITERS so that two concurrent updates cannot both copy the
+   * same snapshot and lose one another's changes. Readers never lock it.
+   */
+  std::mutex writerMutex;
+
+  /* Publishes updatedSnapshot and retires the old one. writerMutex MUST
+   * be held.
+   */
+  void publish(const ContactSnapshot * updatedSnapshot){
+    const ContactSnapshot * oldSnapshot = currentSnapshot.load();
+    currentSnapshot.store(updatedSnapshot);
+    EpochDomain::getInstance().retire(oldSnapshot);
+  }
+
+};
+
+void ConcurrentContactDetailsHandler::setPhoneNumber(int phoneNumberArg){
+  std::lock_guard<std::mutex> lock(writerMutex);
+  /* COPY the current snapshot... Writers hold writerMutex, and the current
+   * snapshot is only retired by a writer, so it cannot be deleted while it
+   * is being copied.
+   */
+  ContactSnapshot * updatedSnapshot = new ContactSnapshot(*currentSnapshot.load());
+  // ...UPDATE the copy...
+  updatedSnapshot->phoneNumber = phoneNumberArg;
+  // ...and PUBLISH it.
+  publish(updatedSnapshot);
+}
+
+void ConcurrentContactDetailsHandler::setAddress(std::string * addressLinesArg, int numAddressLinesArg){
+  std::lock_guard<std::mutex> lock(writerMutex);
+  ContactSnapshot * updatedSnapshot = new ContactSnapshot(*currentSnapshot.load());
+  // Update the address lines and their count TOGETHER in the copy.
+  copyAddress(*updatedSnapshot, addressLinesArg, numAddressLinesArg);
+  publish(updatedSnapshot);
+}
+
+/* Measures the total number of reads per second achieved by numReaders
+ * threads while one writer repeatedly updates the contact.
+ *
+ * This is a FUNCTION TEMPLATE. The compiler generates a separate version
+ * of the function for each Handler type that it is called with.
+ */
+template <typename Handler>
+double measureReadsPerSecond(unsigned int numReaders){
+  Handler contact;
+  std::string address[3] = {"Universal Exports", "London", "United Kingdom"};
+  contact.setAddress(address, 3);
+
+  const int readsPerReader = 200000;
+  std::atomic<bool> readersFinished(false);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> readers;
+  for(unsigned int reader = 0; reader < numReaders; ++reader){
+    readers.push_back(std::thread([&contact, readsPerReader](){
+      for(int read = 0; read < readsPerReader; ++read){
+	contact.getPhoneNumber();
+	contact.getAddress();
+      }
+    }));
+  }
+
+  // The writer keeps updating the contact until the readers have finished.
+  std::thread writer([&contact, &readersFinished](){
+    int write(0);
+    while(!readersFinished){
+      contact.setPhoneNumber(write++);
+      std::this_thread::yield();
+    }
+  });
+
+  for(unsigned int reader = 0; reader < readers.size(); ++reader){
+    readers[reader].join();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  readersFinished = true;
+  writer.join();
+
+  // Each iteration performs TWO reads.
+  return 2.0 * readsPerReader * numReaders / elapsed.count();
+}
+
+#ifndef __CLING__
+int main (){
+#endif
+
+  ConcurrentContactDetailsHandler contact;
+
+  std::string ghostbustersAddress[4] = {"14 N. Moore Street",
+					"New York",
+					"New York",
+					"10013"};
+  std::string bondAddress[3] = {"Universal Exports",
+				"London",
+				"United Kingdom"};
+
+  contact.setAddress(ghostbustersAddress, 4);
+
+  // The two complete addresses that readers may legitimately observe.
+  std::string expectedGhostbusters = "14 N. Moore Street, New York, New York, 10013";
+  std::string expectedBond = "Universal Exports, London, United Kingdom";
+
+  /* Launch several READER threads and ONE WRITER thread. Each std::thread
+   * immediately begins running the lambda expression it is given.
+   */
+  std::vector<std::thread> readers;
+  std::vector<int> tornReads(4, 0);
+  for(int reader = 0; reader < 4; ++reader){
+    readers.push_back(std::thread([&contact, &tornReads, reader,
+				   expectedGhostbusters, expectedBond](){
+      for(int read = 0; read < 100000; ++read){
+	std::string address = contact.getAddress();
+	if(address != expectedGhostbusters && address != expectedBond){
+	  tornReads[reader]++;
+	}
+      }
+    }));
+  }
+
+  std::thread writer([&contact, &ghostbustersAddress, &bondAddress](){
+    for(int write = 0; write < 1000; ++write){
+      if(write % 2 == 0){
+	contact.setAddress(bondAddress, 3);
+      } else {
+	contact.setAddress(ghostbustersAddress, 4);
+      }
+      contact.setPhoneNumber(write);
+    }
+  });
+
+  // Wait for every thread to finish.
+  writer.join();
+  for(unsigned int reader = 0; reader < readers.size(); ++reader){
+    readers[reader].join();
+  }
+
+  int totalTornReads(0);
+  for(unsigned int reader = 0; reader < tornReads.size(); ++reader){
+    totalTornReads += tornReads[reader];
+  }
+
+  // Snapshot publication guarantees that no torn reads are observed.
+  std::cout << "Torn reads: " << totalTornReads << "\n"
+	    << "Final address: " << contact.getAddress() << "\n"
+	    << "Final number: " << contact.getPhoneNumber()
+	    << std::endl;
+
+  /* Start and join many SHORT-LIVED reader threads one after another, as
+   * a thread pool that grows and shrinks would. Each thread returns its
+   * slot when it exits, so the next thread reuses it.
+   */
+  int shortLivedReads(0);
+  for(int thread = 0; thread < 200; ++thread){
+    std::thread shortLivedReader([&contact, &shortLivedReads](){
+      if(contact.getPhoneNumber() == 999){
+	shortLivedReads++;
+      }
+    });
+    shortLivedReader.join();
+  }
+  std::cout << "Short-lived reader threads: " << shortLivedReads << std::endl;
+
+  /* Compare read THROUGHPUT with the mutex baseline for increasing numbers
+   * of reader threads. With snapshot publication the throughput should
+   * grow roughly in proportion to the number of threads, up to the number
+   * of available CPU cores. With the mutex it cannot.
+   */
+  unsigned int numCores = std::thread::hardware_concurrency();
+  std::cout << "Available cores: " << numCores << "\n"
+	    << "Readers\tMutex reads/s\tSnapshot reads/s" << std::endl;
+  for(unsigned int numReaders = 1; numReaders <= 8; numReaders *= 2){
+    std::cout << numReaders << "\t"
+	      << measureReadsPerSecond<MutexContactDetailsHandler>(numReaders) << "\t"
+	      << measureReadsPerSecond<ConcurrentContactDetailsHandler>(numReaders)
+	      << std::endl;
+  }
+
+#ifndef __CLING__
+  return 0;
+}
+#endif